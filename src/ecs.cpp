@@ -1,3 +1 @@
 #include "ecs.h"
-
-Coordinator gCoordinator;
\ No newline at end of file
@@ -1,46 +1,107 @@
+#pragma once
+
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <bitset>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
+#include <ostream>
 #include <set>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 // follows pretty closely https://austinmorlan.com/posts/entity_component_system/
 
 using Entity = std::uint32_t;
 const Entity MAX_ENTITIES = 5000;
+// Returned by createEntity once every id is in use
+const Entity NULL_ENTITY = MAX_ENTITIES;
 
 using ComponentType = std::uint8_t;
 const ComponentType MAX_COMPONENTS = 32;
 
 using Signature = std::bitset<MAX_COMPONENTS>;
 
+const size_t MAX_EVENTS = 1024;
+
+// Unused ids live in a FIFO ring indexed by two ever-growing counters. createEntity
+// pops with a CAS on the head and is safe from any thread; destroyEntity pushes at the
+// tail and must only be called from the thread that owns the world.
 class EntityManager {
    public:
     EntityManager() {
         for (Entity entity = 0; entity < MAX_ENTITIES; ++entity) {
-            unusedEntities.push(entity);
+            unusedEntities[entity].store(entity, std::memory_order_relaxed);
+        }
+        unusedTail.store(MAX_ENTITIES, std::memory_order_release);
+    }
+
+    EntityManager(const EntityManager& other) : signatures(other.signatures) {
+        for (Entity index = 0; index < MAX_ENTITIES; ++index) {
+            unusedEntities[index].store(other.unusedEntities[index].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            generations[index].store(other.generations[index].load(std::memory_order_relaxed), std::memory_order_relaxed);
         }
+        unusedHead.store(other.unusedHead.load(std::memory_order_acquire), std::memory_order_relaxed);
+        unusedTail.store(other.unusedTail.load(std::memory_order_acquire), std::memory_order_relaxed);
+        livingEntityCount.store(other.livingEntityCount.load(std::memory_order_relaxed), std::memory_order_release);
     }
 
+    EntityManager& operator=(const EntityManager&) = delete;
+
+    // Running out of ids is a bug here, use tryCreateEntity where it is expected
     Entity createEntity() {
-        assert(livingEntityCount < MAX_ENTITIES && "Too many entities in existence.");
+        Entity entity = tryCreateEntity();
+        assert(entity != NULL_ENTITY && "Too many entities in existence.");
+        return entity;
+    }
 
-        Entity id = unusedEntities.front();
-        unusedEntities.pop();
-        ++livingEntityCount;
+    // Returns NULL_ENTITY when every id is in use, the head never passes the tail
+    Entity tryCreateEntity() {
+        std::uint64_t head = unusedHead.load(std::memory_order_acquire);
+        while (true) {
+            // Acquiring the tail makes the slot written before destroyEntity's release visible
+            std::uint64_t tail = unusedTail.load(std::memory_order_acquire);
+            if (head >= tail) {
+                return NULL_ENTITY;
+            }
 
-        return id;
+            // A stale head may read a recycled slot, the CAS then fails and we retry
+            Entity id = unusedEntities[head % MAX_ENTITIES].load(std::memory_order_relaxed);
+            if (unusedHead.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                livingEntityCount.fetch_add(1, std::memory_order_relaxed);
+                return id;
+            }
+        }
     }
 
     void destroyEntity(Entity entity) {
         assert(entity < MAX_ENTITIES && "Entity out of range.");
 
         signatures[entity].reset();
-        unusedEntities.push(entity);
-        --livingEntityCount;
+        generations[entity].fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t tail = unusedTail.load(std::memory_order_relaxed);
+        unusedEntities[tail % MAX_ENTITIES].store(entity, std::memory_order_relaxed);
+        unusedTail.store(tail + 1, std::memory_order_release);
+        livingEntityCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Bumped whenever the id is freed, so a stored (id, generation) pair goes stale
+    std::uint32_t getGeneration(Entity entity) const {
+        assert(entity < MAX_ENTITIES && "Entity out of range.");
+        return generations[entity].load(std::memory_order_relaxed);
+    }
+
+    uint32_t getLivingEntityCount() const {
+        return livingEntityCount.load(std::memory_order_relaxed);
     }
 
     void setSignature(Entity entity, Signature signature) {
@@ -54,86 +115,270 @@ class EntityManager {
     }
 
    private:
-    std::queue<Entity> unusedEntities{};
+    std::array<std::atomic<Entity>, MAX_ENTITIES> unusedEntities{};
+    std::atomic<std::uint64_t> unusedHead{};
+    std::atomic<std::uint64_t> unusedTail{};
     std::array<Signature, MAX_ENTITIES> signatures{};
-    uint32_t livingEntityCount{};
+    std::array<std::atomic<std::uint32_t>, MAX_ENTITIES> generations{};
+    std::atomic<uint32_t> livingEntityCount{};
 };
 
+// Process-wide index per component type, handed out on first use. Every world uses the
+// same index for a type, so pools are found by array index without any hashing.
+inline ComponentType nextComponentTypeIndex() {
+    static std::atomic<unsigned> next{0};
+    unsigned index = next.fetch_add(1, std::memory_order_relaxed);
+    assert(index < MAX_COMPONENTS && "Too many component types in existence.");
+    return ComponentType(index);
+}
+
+template <typename T>
+ComponentType componentTypeIndex() {
+    static const ComponentType index = nextComponentTypeIndex();
+    return index;
+}
+
+// Whether fork() may copy components of type T. Only trivially copyable types are
+// trusted by default, is_copy_constructible also reports true for aggregates holding
+// move-only members. Specialise as std::true_type to opt other copyable types in.
+template <typename T>
+struct CopyableComponent : std::is_trivially_copyable<T> {};
+
 class IComponentArray {
    public:
     virtual ~IComponentArray() = default;
     virtual void entityDestroyed(Entity entity) = 0;
+    virtual bool isCopyable() const = 0;
+    // Returns nullptr unless isCopyable()
+    virtual std::unique_ptr<IComponentArray> clone() const = 0;
+    virtual void mergeFrom(IComponentArray& other, const std::vector<Entity>& remap) = 0;
 };
 
 template <typename T>
 class ComponentArray : public IComponentArray {
    public:
-    void insertData(Entity entity, T component) {
-        assert(entityToIndexMap.find(entity) == entityToIndexMap.end() && "Component added to the same entity more than once.");
+    ComponentArray() {
+        entityToIndex.fill(INVALID_INDEX);
+    }
+
+    // Only instantiated through clone() for CopyableComponent types
+    ComponentArray(const ComponentArray& other)
+        : entityToIndex(other.entityToIndex), indexToEntity(other.indexToEntity) {
+        for (size_t index = 0; index < other.size; ++index) {
+            new (&componentArray[index]) T(other.slot(index));
+            ++size;
+        }
+    }
+
+    ComponentArray& operator=(const ComponentArray&) = delete;
+
+    ~ComponentArray() override {
+        for (size_t index = 0; index < size; ++index) {
+            slot(index).~T();
+        }
+    }
+
+    // Constructs the component in place at the end of the dense array
+    template <typename... Args>
+    T& emplaceData(Entity entity, Args&&... args) {
+        assert(!hasData(entity) && "Component added to the same entity more than once.");
         // Put new entry at the end and update the maps
         size_t newIndex = size;
-        entityToIndexMap[entity] = newIndex;
-        indexToEntityMap[newIndex] = entity;
-        componentArray[newIndex] = component;
+        T* component = new (&componentArray[newIndex]) T(std::forward<Args>(args)...);
+        entityToIndex[entity] = newIndex;
+        indexToEntity[newIndex] = entity;
         ++size;
+        ++version;
+        ++layoutVersion;
+        return *component;
     }
 
     void removeData(Entity entity) {
-        assert(entityToIndexMap.find(entity) != entityToIndexMap.end() && "Removing a non-existent component.");
+        assert(hasData(entity) && "Removing a non-existent component.");
 
-        size_t indexOfRemoved = entityToIndexMap[entity];
+        size_t indexOfRemoved = entityToIndex[entity];
         size_t indexOfLast = size - 1;
-        componentArray[indexOfRemoved] = componentArray[indexOfLast];
+        if (indexOfRemoved != indexOfLast) {
+            slot(indexOfRemoved) = std::move(slot(indexOfLast));
+        }
+        slot(indexOfLast).~T();
 
-        Entity entityOfLast = indexToEntityMap[indexOfLast];
-        entityToIndexMap[entityOfLast] = indexOfRemoved;
-        indexToEntityMap[indexOfRemoved] = entityOfLast;
+        Entity entityOfLast = indexToEntity[indexOfLast];
+        entityToIndex[entityOfLast] = indexOfRemoved;
+        indexToEntity[indexOfRemoved] = entityOfLast;
 
-        indexToEntityMap.erase(indexOfLast);
-        entityToIndexMap.erase(entity);
+        entityToIndex[entity] = INVALID_INDEX;
         size--;
+        ++version;
+        ++layoutVersion;
     }
 
     T& getData(Entity entity) {
-        assert(entityToIndexMap.find(entity) != entityToIndexMap.end() && "Retrieving a non-existent component.");
+        assert(hasData(entity) && "Retrieving a non-existent component.");
+
+        return slot(entityToIndex[entity]);
+    }
+
+    T* tryGetData(Entity entity) {
+        return hasData(entity) ? &slot(entityToIndex[entity]) : nullptr;
+    }
+
+    bool hasData(Entity entity) const {
+        assert(entity < MAX_ENTITIES && "Entity out of range.");
+        return entityToIndex[entity] != INVALID_INDEX;
+    }
+
+    size_t getIndex(Entity entity) const {
+        assert(hasData(entity) && "Retrieving a non-existent component.");
+        return entityToIndex[entity];
+    }
+
+    Entity getEntity(size_t index) const {
+        assert(index < size && "Index out of range.");
+        return indexToEntity[index];
+    }
+
+    size_t getSize() const {
+        return size;
+    }
 
-        return componentArray[entityToIndexMap[entity]];
+    // Bumped by every insertion and removal, but not by swaps
+    std::uint32_t getVersion() const {
+        return version;
+    }
+
+    // Bumped by any change to the dense order, swaps included
+    std::uint32_t getLayoutVersion() const {
+        return layoutVersion;
+    }
+
+    T* data() {
+        return reinterpret_cast<T*>(componentArray.data());
+    }
+
+    // Swaps two dense entries and keeps both maps in sync, used by groups to reorder pools
+    void swapData(size_t indexA, size_t indexB) {
+        assert(indexA < size && indexB < size && "Index out of range.");
+        if (indexA == indexB) {
+            return;
+        }
+
+        using std::swap;
+        swap(slot(indexA), slot(indexB));
+        ++layoutVersion;
+
+        Entity entityA = indexToEntity[indexA];
+        Entity entityB = indexToEntity[indexB];
+        entityToIndex[entityA] = indexB;
+        entityToIndex[entityB] = indexA;
+        indexToEntity[indexA] = entityB;
+        indexToEntity[indexB] = entityA;
     }
 
     void entityDestroyed(Entity entity) override {
-        if (entityToIndexMap.find(entity) != entityToIndexMap.end()) {
+        if (hasData(entity)) {
             removeData(entity);
         }
     }
 
+    bool isCopyable() const override {
+        return CopyableComponent<T>::value;
+    }
+
+    std::unique_ptr<IComponentArray> clone() const override {
+        // The discarded branch is never instantiated, so move-only types still compile
+        if constexpr (CopyableComponent<T>::value) {
+            return std::make_unique<ComponentArray<T>>(*this);
+        } else {
+            return nullptr;
+        }
+    }
+
+    // Moves every component of another pool of the same type onto the end of this one,
+    // remap translates the other world's entities into this world's
+    void mergeFrom(IComponentArray& other, const std::vector<Entity>& remap) override {
+        auto& source = static_cast<ComponentArray<T>&>(other);
+        assert(size + source.size <= MAX_ENTITIES && "Too many components in existence.");
+
+        for (size_t index = 0; index < source.size; ++index) {
+            emplaceData(remap[source.indexToEntity[index]], std::move(source.slot(index)));
+        }
+    }
+
    private:
-    std::array<T, MAX_ENTITIES> componentArray;
-    std::unordered_map<Entity, size_t> entityToIndexMap;
-    std::unordered_map<size_t, Entity> indexToEntityMap;
-    size_t size;
+    static constexpr size_t INVALID_INDEX = MAX_ENTITIES;
+
+    // Raw storage, slots past size are never constructed
+    std::array<typename std::aligned_storage<sizeof(T), alignof(T)>::type, MAX_ENTITIES> componentArray;
+    // Flat sparse/dense maps, an entity without a component maps to INVALID_INDEX
+    std::array<size_t, MAX_ENTITIES> entityToIndex;
+    std::array<Entity, MAX_ENTITIES> indexToEntity;
+    size_t size{};
+    std::uint32_t version{};
+    std::uint32_t layoutVersion{};
+
+    T& slot(size_t index) {
+        return *reinterpret_cast<T*>(&componentArray[index]);
+    }
+
+    const T& slot(size_t index) const {
+        return *reinterpret_cast<const T*>(&componentArray[index]);
+    }
 };
 
 class ComponentManager {
    public:
+    ComponentManager() = default;
+
+    // Deep copy, every pool is cloned so the copy shares no state with the original.
+    // Requires isCopyable().
+    ComponentManager(const ComponentManager& other) : registered(other.registered) {
+        assert(other.isCopyable() && "Copying a pool of a component that is not a CopyableComponent.");
+        for (ComponentType type = 0; type < MAX_COMPONENTS; ++type) {
+            if (other.componentArrays[type]) {
+                componentArrays[type] = other.componentArrays[type]->clone();
+            }
+        }
+    }
+
+    bool isCopyable() const {
+        for (auto const& component : componentArrays) {
+            if (component && !component->isCopyable()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     template <typename T>
     void registerComponent() {
-        const char* typeName = typeid(T).name();
-        assert(componentTypes.find(typeName) == componentTypes.end() && "Registering a component type more than once.");
-        componentTypes.insert({typeName, nextComponentType});
-        componentArrays.insert({typeName, std::make_shared<ComponentArray<T>>()});
-        nextComponentType++;
+        ComponentType type = componentTypeIndex<T>();
+        assert(!registered.test(type) && "Registering a component type more than once.");
+        registered.set(type);
+        componentArrays[type] = std::make_unique<ComponentArray<T>>();
     }
 
     template <typename T>
     ComponentType getComponentType() {
-        const char* typeName = typeid(T).name();
-        assert(componentTypes.find(typeName) != componentTypes.end() && "Component not registered before use.");
-        return componentTypes[typeName];
+        ComponentType type = componentTypeIndex<T>();
+        assert(registered.test(type) && "Component not registered before use.");
+        return type;
     }
 
-    template <typename T>
-    void addComponent(Entity entity, T component) {
-        getComponentArray<T>()->insertData(entity, component);
+    // Appends all pools of other onto the matching pools here. Component types are the
+    // same in every world, so signatures carry over unchanged.
+    void merge(ComponentManager& other, const std::vector<Entity>& remap) {
+        assert((other.registered & ~registered).none() && "Merging a component that is not registered.");
+        for (ComponentType type = 0; type < MAX_COMPONENTS; ++type) {
+            if (other.registered.test(type)) {
+                componentArrays[type]->mergeFrom(*other.componentArrays[type], remap);
+            }
+        }
+    }
+
+    template <typename T, typename... Args>
+    T& emplaceComponent(Entity entity, Args&&... args) {
+        return getComponentArray<T>()->emplaceData(entity, std::forward<Args>(args)...);
     }
 
     template <typename T>
@@ -146,47 +391,314 @@ class ComponentManager {
         return getComponentArray<T>()->getData(entity);
     }
 
+    template <typename T>
+    T* tryGetComponent(Entity entity) {
+        return getComponentArray<T>()->tryGetData(entity);
+    }
+
     void entityDestroyed(Entity entity) {
-        for (auto const& pair : componentArrays) {
-            auto const& component = pair.second;
-            component->entityDestroyed(entity);
+        for (auto const& component : componentArrays) {
+            if (component) {
+                component->entityDestroyed(entity);
+            }
         }
     }
 
+    // The pool stays owned by this manager and lives as long as the world
+    template <typename T>
+    ComponentArray<T>* getComponentArray() {
+        return static_cast<ComponentArray<T>*>(componentArrays[getComponentType<T>()].get());
+    }
+
+   private:
+    Signature registered{};
+    std::array<std::unique_ptr<IComponentArray>, MAX_COMPONENTS> componentArrays{};
+};
+
+// Typed access to one pool that skips the type lookup altogether. Valid as long as the
+// world it came from, so systems can fetch it once and keep it across frames.
+template <typename T>
+class ComponentHandle {
+   public:
+    ComponentHandle() = default;
+    explicit ComponentHandle(ComponentArray<T>* array) : array(array) {}
+
+    T& get(Entity entity) {
+        return array->getData(entity);
+    }
+
+    T* tryGet(Entity entity) {
+        return array->tryGetData(entity);
+    }
+
+    bool has(Entity entity) const {
+        return array->hasData(entity);
+    }
+
+    ComponentArray<T>* operator->() {
+        return array;
+    }
+
    private:
-    std::unordered_map<const char*, ComponentType> componentTypes{};
-    std::unordered_map<const char*, std::shared_ptr<IComponentArray>> componentArrays{};
-    ComponentType nextComponentType{};
+    ComponentArray<T>* array{};
+};
+
+class IGroup {
+   public:
+    virtual ~IGroup() = default;
+    virtual void entityDestroyed(Entity entity) = 0;
+    virtual void entitySignatureChanged(Entity entity, Signature entitySignature) = 0;
+    virtual std::shared_ptr<IGroup> clone(ComponentManager& componentManager) const = 0;
+};
+
+// Owning group: the first getSize() entries of every owned pool belong to the same
+// entities in the same order, so systems can walk them as parallel arrays.
+// Entities are swapped into and out of that prefix as their signature changes.
+template <typename... Ts>
+class Group : public IGroup {
+   public:
+    Group(Signature signature, ComponentArray<Ts>*... arrays)
+        : signature(signature), arrays(arrays...) {}
+
+    size_t getSize() const {
+        return size;
+    }
+
+    Entity getEntity(size_t index) const {
+        assert(index < size && "Index out of range.");
+        return std::get<0>(arrays)->getEntity(index);
+    }
 
     template <typename T>
-    std::shared_ptr<ComponentArray<T>> getComponentArray() {
-        const char* typeName = typeid(T).name();
-        assert(componentTypes.find(typeName) != componentTypes.end() && "Component not registered before use.");
-        return std::static_pointer_cast<ComponentArray<T>>(componentArrays[typeName]);
+    T* data() {
+        return std::get<ComponentArray<T>*>(arrays)->data();
+    }
+
+    template <typename T>
+    T& get(size_t index) {
+        assert(index < size && "Index out of range.");
+        return data<T>()[index];
+    }
+
+    void entityDestroyed(Entity entity) override {
+        if (contains(entity)) {
+            --size;
+            moveTo(entity, size);
+        }
+    }
+
+    void entitySignatureChanged(Entity entity, Signature entitySignature) override {
+        bool matches = (entitySignature & signature) == signature;
+        bool member = contains(entity);
+
+        // Entity gained the last owned component - swap it to the end of the prefix
+        if (matches && !member) {
+            moveTo(entity, size);
+            ++size;
+        }
+        // Entity is about to lose an owned component - swap it just past the prefix
+        else if (!matches && member) {
+            --size;
+            moveTo(entity, size);
+        }
+    }
+
+    // Rebinds the group to the pools of another (already copied) world
+    std::shared_ptr<IGroup> clone(ComponentManager& componentManager) const override {
+        auto group = std::make_shared<Group<Ts...>>(signature, componentManager.getComponentArray<Ts>()...);
+        group->size = size;
+        return group;
+    }
+
+   private:
+    Signature signature;
+    std::tuple<ComponentArray<Ts>*...> arrays;
+    size_t size{};
+
+    bool contains(Entity entity) const {
+        auto const& first = std::get<0>(arrays);
+        return first->hasData(entity) && first->getIndex(entity) < size;
+    }
+
+    void moveTo(Entity entity, size_t index) {
+        int expand[] = {(std::get<ComponentArray<Ts>*>(arrays)->swapData(
+                             std::get<ComponentArray<Ts>*>(arrays)->getIndex(entity), index),
+                         0)...};
+        (void)expand;
+    }
+};
+
+class GroupManager {
+   public:
+    GroupManager() = default;
+
+    GroupManager(const GroupManager& other, ComponentManager& componentManager)
+        : ownedComponents(other.ownedComponents) {
+        for (auto const& pair : other.groups) {
+            groups.insert({pair.first, pair.second->clone(componentManager)});
+        }
+    }
+
+    template <typename... Ts>
+    std::shared_ptr<Group<Ts...>> registerGroup(Signature signature, ComponentArray<Ts>*... arrays) {
+        const char* typeName = typeid(Group<Ts...>).name();
+        assert(groups.find(typeName) == groups.end() && "Registering a group more than once.");
+        assert((ownedComponents & signature).none() && "Component already owned by another group.");
+        ownedComponents |= signature;
+
+        auto group = std::make_shared<Group<Ts...>>(signature, arrays...);
+        groups.insert({typeName, group});
+        return group;
+    }
+
+    template <typename... Ts>
+    std::shared_ptr<Group<Ts...>> getGroup() {
+        const char* typeName = typeid(Group<Ts...>).name();
+        assert(groups.find(typeName) != groups.end() && "Group used before registered.");
+        return std::static_pointer_cast<Group<Ts...>>(groups[typeName]);
+    }
+
+    bool isOwned(ComponentType type) const {
+        return ownedComponents.test(type);
+    }
+
+    void entityDestroyed(Entity entity) {
+        for (auto const& pair : groups) {
+            pair.second->entityDestroyed(entity);
+        }
+    }
+
+    void entitySignatureChanged(Entity entity, Signature entitySignature) {
+        for (auto const& pair : groups) {
+            pair.second->entitySignatureChanged(entity, entitySignature);
+        }
+    }
+
+   private:
+    Signature ownedComponents{};
+    std::unordered_map<const char*, std::shared_ptr<IGroup>> groups{};
+};
+
+// Query terms, e.g. compileQuery<With<Transform, RigidBody>, Without<Sleeping>>()
+template <typename... Ts>
+struct With {};
+template <typename... Ts>
+struct Without {};
+template <typename... Ts>
+struct Optional {};
+template <typename... Ts>
+struct AnyOf {};
+
+// Compiled query. With and Without terms fold into a single mask/value pair so an
+// entity signature is tested in one step; the AnyOf term adds one more mask.
+// Optional terms do not filter, fetch them with tryGetComponent. Use at most one AnyOf term.
+struct Query {
+    Signature mask{};
+    Signature value{};
+    Signature anyOf{};
+
+    Query() = default;
+
+    // Plain "has all of these components" query
+    explicit Query(Signature signature) : mask(signature), value(signature) {}
+
+    bool matches(Signature signature) const {
+        return (signature & mask) == value && (anyOf.none() || (signature & anyOf).any());
     }
 };
 
 class System {
    public:
+    virtual ~System() = default;
+
+    // Called after an entity joins entities, e.g. to reset per-entity state of a recycled id
+    virtual void entityAdded(Entity) {}
+
     std::set<Entity> entities;
 };
 
+// Whether fork() may copy a system of type T. Systems holding move-only members such as a
+// unique_ptr or a mutex are detected, specialise as std::false_type for copy constructors
+// that are declared but do not compile (e.g. a vector of unique_ptr).
+template <typename T>
+struct CopyableSystem : std::is_copy_constructible<T> {};
+
 class SystemManager {
    public:
+    SystemManager() = default;
+
+    // Copies every system through the cloner captured at registration, including its
+    // entity set. Requires isCopyable().
+    SystemManager(const SystemManager& other)
+        : queries(other.queries), cloners(other.cloners) {
+        assert(other.isCopyable() && "Copying a system that is not a CopyableSystem.");
+        for (auto const& pair : other.systems) {
+            systems.insert({pair.first, cloners[pair.first](*pair.second)});
+        }
+    }
+
+    bool isCopyable() const {
+        for (auto const& pair : cloners) {
+            if (!pair.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     template <typename T>
     std::shared_ptr<T> registerSystem() {
         const char* typeName = typeid(T).name();
         assert(systems.find(typeName) == systems.end() && "Registering a system more than once.");
         auto system = std::make_shared<T>();
         systems.insert({typeName, system});
+        // No cloner for other types, so their copy constructor is never instantiated
+        if constexpr (CopyableSystem<T>::value) {
+            cloners.insert({typeName, [](System const& other) -> std::shared_ptr<System> {
+                                return std::make_shared<T>(static_cast<T const&>(other));
+                            }});
+        } else {
+            cloners.insert({typeName, nullptr});
+        }
         return system;
     }
 
+    template <typename T>
+    std::shared_ptr<T> getSystem() {
+        const char* typeName = typeid(T).name();
+        assert(systems.find(typeName) != systems.end() && "System used before registered.");
+        return std::static_pointer_cast<T>(systems[typeName]);
+    }
+
     template <typename T>
     void setSignature(Signature signature) {
+        setQuery<T>(Query(signature));
+    }
+
+    template <typename T>
+    void setQuery(Query query) {
+        const char* typeName = typeid(T).name();
+        assert(systems.find(typeName) != systems.end() && "System used before registered.");
+        queries[typeName] = query;
+    }
+
+    // Re-evaluates the query of T against every entity, e.g. after setQuery on a populated world
+    template <typename T>
+    void refreshEntities(EntityManager& entityManager) {
         const char* typeName = typeid(T).name();
         assert(systems.find(typeName) != systems.end() && "System used before registered.");
-        signatures.insert({typeName, signature});
+        auto const& system = systems[typeName];
+        auto const& systemQuery = queries[typeName];
+
+        for (Entity entity = 0; entity < MAX_ENTITIES; ++entity) {
+            if (isMember(systemQuery, entityManager.getSignature(entity))) {
+                if (system->entities.insert(entity).second) {
+                    system->entityAdded(entity);
+                }
+            } else {
+                system->entities.erase(entity);
+            }
+        }
     }
 
     void entityDestroyed(Entity entity) {
@@ -200,13 +712,15 @@ class SystemManager {
         for (auto const& pair : systems) {
             auto const& type = pair.first;
             auto const& system = pair.second;
-            auto const& systemSignature = signatures[type];
+            auto const& systemQuery = queries[type];
 
-            // Entity signature matches system signature - insert into the set
-            if ((entitySignature & systemSignature) == systemSignature) {
-                system->entities.insert(entity);
+            // Entity signature matches system query - insert into the set
+            if (isMember(systemQuery, entitySignature)) {
+                if (system->entities.insert(entity).second) {
+                    system->entityAdded(entity);
+                }
             }
-            // Entity signature does not match system signature - erase from the set
+            // Entity signature does not match system query - erase from the set
             else {
                 system->entities.erase(entity);
             }
@@ -214,56 +728,484 @@ class SystemManager {
     }
 
    private:
-    std::unordered_map<const char*, Signature> signatures{};
+    std::unordered_map<const char*, Query> queries{};
     std::unordered_map<const char*, std::shared_ptr<System>> systems{};
+
+    // An empty signature cannot tell a bare entity from an unused id, so entities without
+    // components belong to no system, not even one whose query only has Without terms
+    static bool isMember(Query const& query, Signature entitySignature) {
+        return entitySignature.any() && query.matches(entitySignature);
+    }
+
+    std::unordered_map<const char*, std::function<std::shared_ptr<System>(System const&)>> cloners{};
+};
+
+// Sort key for pool passes, entries are ordered by key and then by entity
+using SortKey = std::function<std::uint64_t(Entity)>;
+
+class ISortPass {
+   public:
+    virtual ~ISortPass() = default;
+    // Returns true once the pool is in key order, false if it ran out of time
+    virtual bool step(std::chrono::steady_clock::time_point deadline) = 0;
+};
+
+// Reorders one pool into key order a few swaps at a time, keeping the pool's maps in
+// sync after every swap. The target order is recomputed whenever the pool gains or
+// loses entries, or when the optional dependency (whatever the key reads) reports a
+// change, so a finished pass stays idle until churn has scrambled the pool again.
+template <typename T>
+class SortPass : public ISortPass {
+   public:
+    SortPass(ComponentArray<T>* array, SortKey key, std::function<std::uint32_t()> dependency = nullptr)
+        : array(array), key(std::move(key)), dependency(std::move(dependency)) {}
+
+    bool step(std::chrono::steady_clock::time_point deadline) override {
+        if (!started || array->getVersion() != version || (dependency && dependency() != dependencyVersion)) {
+            restart();
+        }
+
+        while (cursor < order.size()) {
+            array->swapData(array->getIndex(order[cursor].second), cursor);
+            ++cursor;
+
+            if (cursor % 64 == 0 && std::chrono::steady_clock::now() >= deadline) {
+                return cursor == order.size();
+            }
+        }
+        return true;
+    }
+
+   private:
+    ComponentArray<T>* array;
+    SortKey key;
+    std::function<std::uint32_t()> dependency;
+    std::uint32_t dependencyVersion{};
+    std::vector<std::pair<std::uint64_t, Entity>> order{};
+    size_t cursor{};
+    std::uint32_t version{};
+    bool started{};
+
+    void restart() {
+        order.clear();
+        for (size_t index = 0; index < array->getSize(); ++index) {
+            Entity entity = array->getEntity(index);
+            order.push_back({key(entity), entity});
+        }
+        std::sort(order.begin(), order.end());
+
+        cursor = 0;
+        version = array->getVersion();
+        dependencyVersion = dependency ? dependency() : 0;
+        started = true;
+    }
+};
+
+class SortManager {
+   public:
+    // Replaces any pass already registered for this pool
+    void setPass(ComponentType type, std::unique_ptr<ISortPass> pass) {
+        for (auto& pair : passes) {
+            if (pair.first == type) {
+                pair.second = std::move(pass);
+                return;
+            }
+        }
+        passes.push_back({type, std::move(pass)});
+    }
+
+    bool hasPass(ComponentType type) const {
+        for (auto const& pair : passes) {
+            if (pair.first == type) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void removePass(ComponentType type) {
+        passes.erase(std::remove_if(passes.begin(), passes.end(), [type](auto const& pair) { return pair.first == type; }), passes.end());
+    }
+
+    // Steps passes round-robin until all are sorted or the deadline passes
+    void run(std::chrono::steady_clock::time_point deadline) {
+        for (size_t visited = 0; visited < passes.size(); ++visited) {
+            if (next >= passes.size()) {
+                next = 0;
+            }
+            if (!passes[next].second->step(deadline)) {
+                return;
+            }
+            ++next;
+        }
+    }
+
+   private:
+    std::vector<std::pair<ComponentType, std::unique_ptr<ISortPass>>> passes{};
+    size_t next{};
 };
 
+class IEventChannel {
+   public:
+    virtual ~IEventChannel() = default;
+    virtual void swap() = 0;
+    virtual std::shared_ptr<IEventChannel> clone() const = 0;
+};
+
+template <typename E>
+class EventView {
+   public:
+    EventView(const E* first, size_t count) : first(first), count(count) {}
+
+    const E* begin() const { return first; }
+    const E* end() const { return first + count; }
+    size_t size() const { return count; }
+
+   private:
+    const E* first;
+    size_t count;
+};
+
+// Two fixed buffers of MAX_EVENTS events each. Writers on any thread claim a slot with a
+// single fetch_add, swap() at the frame boundary publishes what was written so every reader
+// sees it for exactly one frame. Events past capacity are dropped, nothing is ever allocated.
+template <typename E>
+class EventChannel : public IEventChannel {
+    static_assert(std::is_trivially_copyable<E>::value, "Events must be trivially copyable.");
+
+   public:
+    EventChannel() = default;
+
+    EventChannel(const EventChannel& other)
+        : buffers(other.buffers), writeBuffer(other.writeBuffer), readCount(other.readCount) {
+        writeCount.store(other.writeCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dropped.store(other.dropped.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    EventChannel& operator=(const EventChannel&) = delete;
+
+    // Returns false if this frame's buffer is already full
+    bool send(const E& event) {
+        size_t index = writeCount.fetch_add(1, std::memory_order_relaxed);
+        if (index >= MAX_EVENTS) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        buffers[writeBuffer][index] = event;
+        return true;
+    }
+
+    // Everything sent during the previous frame
+    EventView<E> read() const {
+        return EventView<E>(buffers[writeBuffer ^ 1].data(), readCount);
+    }
+
+    size_t getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    // Must not race with send, call it at a sync point
+    void swap() override {
+        size_t written = writeCount.exchange(0, std::memory_order_acq_rel);
+        readCount = written < MAX_EVENTS ? written : MAX_EVENTS;
+        writeBuffer ^= 1;
+    }
+
+    std::shared_ptr<IEventChannel> clone() const override {
+        return std::make_shared<EventChannel<E>>(*this);
+    }
+
+   private:
+    std::array<std::array<E, MAX_EVENTS>, 2> buffers{};
+    size_t writeBuffer{};
+    size_t readCount{};
+    std::atomic<size_t> writeCount{};
+    std::atomic<size_t> dropped{};
+};
+
+class EventManager {
+   public:
+    EventManager() = default;
+
+    EventManager(const EventManager& other) {
+        for (auto const& pair : other.channels) {
+            channels.insert({pair.first, pair.second->clone()});
+        }
+    }
+
+    template <typename E>
+    void registerEvent() {
+        const char* typeName = typeid(E).name();
+        assert(channels.find(typeName) == channels.end() && "Registering an event type more than once.");
+        channels.insert({typeName, std::make_shared<EventChannel<E>>()});
+    }
+
+    // Only reads the map, so safe to call from many threads once registration is done
+    template <typename E>
+    EventChannel<E>* getEventChannel() {
+        auto it = channels.find(typeid(E).name());
+        assert(it != channels.end() && "Event not registered before use.");
+        return static_cast<EventChannel<E>*>(it->second.get());
+    }
+
+    void swap() {
+        for (auto const& pair : channels) {
+            pair.second->swap();
+        }
+    }
+
+   private:
+    std::unordered_map<const char*, std::shared_ptr<IEventChannel>> channels{};
+};
+
+// Text log of a world's structural operations, one per line, replayed by tools/replay.cpp.
+// Component and system names are only used to tell types apart, types are referred to by
+// their ComponentType afterwards. Writes are serialised, so worker threads may create entities.
+class CommandLog {
+   public:
+    explicit CommandLog(std::ostream& out) : out(out) {}
+
+    void registerComponent(ComponentType type, const char* name) {
+        write('r', unsigned(type), name);
+    }
+
+    void systemQuery(const char* name, Query const& query) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "q " << name << ' ' << query.mask << ' ' << query.value << ' ' << query.anyOf << '\n';
+    }
+
+    void createEntity(Entity entity) {
+        write('c', entity);
+    }
+
+    void destroyEntity(Entity entity) {
+        write('d', entity);
+    }
+
+    void addComponent(Entity entity, ComponentType type) {
+        write('a', entity, unsigned(type));
+    }
+
+    void removeComponent(Entity entity, ComponentType type) {
+        write('x', entity, unsigned(type));
+    }
+
+    // A system ran over count of its entities, the replay touches as many of them
+    void systemRun(const char* name, size_t count) {
+        write('u', name, count);
+    }
+
+    // Frame boundary. Flushes, so the log is complete up to here even if the process
+    // never exits cleanly (e.g. a browser tab).
+    void frame(float dt) {
+        write('f', dt);
+        std::lock_guard<std::mutex> lock(mutex);
+        out.flush();
+    }
+
+   private:
+    std::mutex mutex;
+    std::ostream& out;
+
+    template <typename... Args>
+    void write(char op, Args const&... args) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << op;
+        int expand[] = {(out << ' ' << args, 0)...};
+        (void)expand;
+        out << '\n';
+    }
+};
+
+// A self-contained world. Nothing is shared between instances, so separate worlds
+// may be simulated on separate threads; systems receive their world explicitly.
 class Coordinator {
    public:
-    void init() {
+    Coordinator() {
         // Create pointers to each manager
         componentManager = std::make_unique<ComponentManager>();
         entityManager = std::make_unique<EntityManager>();
         systemManager = std::make_unique<SystemManager>();
+        groupManager = std::make_unique<GroupManager>();
+        eventManager = std::make_unique<EventManager>();
+        sortManager = std::make_unique<SortManager>();
+    }
+
+    Coordinator(Coordinator&&) = default;
+    Coordinator& operator=(Coordinator&&) = default;
+
+    // Deep copy of the whole world, e.g. for speculative simulation. Registered systems
+    // are copied too and must be retrieved from the fork through getSystem<T>().
+    // Aborts unless canFork(), also in release builds.
+    Coordinator fork() const {
+        assert(canFork() && "Forking a world holding components or systems that cannot be copied.");
+        if (!canFork()) {
+            std::abort();
+        }
+        return Coordinator(*this);
+    }
+
+    // True when every registered component type and system can be copied
+    bool canFork() const {
+        return componentManager->isCopyable() && systemManager->isCopyable();
+    }
+
+    // Records every following structural operation, pass nullptr to stop. Not carried over by fork().
+    void setRecorder(CommandLog* log) {
+        recorder = log;
     }
 
     // Entity methods
+
+    // Safe to call from worker threads. The new entity has no components until the
+    // CommandBuffer carrying them is committed on the world's own thread. Returns
+    // NULL_ENTITY once every id is in use.
     Entity createEntity() {
-        return entityManager->createEntity();
+        Entity entity = entityManager->createEntity();
+        if (recorder && entity != NULL_ENTITY) {
+            recorder->createEntity(entity);
+        }
+        return entity;
+    }
+
+    // Changes every time the id is freed, lets deferred writes detect a destroyed target
+    std::uint32_t getGeneration(Entity entity) const {
+        return entityManager->getGeneration(entity);
     }
 
     void destroyEntity(Entity entity) {
+        if (recorder) {
+            recorder->destroyEntity(entity);
+        }
+
+        // Leave groups first so the pools' swap-and-pop cannot break the group prefix
+        groupManager->entityDestroyed(entity);
         entityManager->destroyEntity(entity);
         componentManager->entityDestroyed(entity);
         systemManager->entityDestroyed(entity);
     }
 
+    // Frees a whole batch, e.g. the region returned by merge(), one manager at a time
+    void destroyEntities(const std::vector<Entity>& entities) {
+        if (recorder) {
+            for (auto const& entity : entities) {
+                recorder->destroyEntity(entity);
+            }
+        }
+
+        for (auto const& entity : entities) {
+            groupManager->entityDestroyed(entity);
+        }
+        for (auto const& entity : entities) {
+            componentManager->entityDestroyed(entity);
+        }
+        for (auto const& entity : entities) {
+            systemManager->entityDestroyed(entity);
+        }
+        for (auto const& entity : entities) {
+            entityManager->destroyEntity(entity);
+        }
+    }
+
+    // Moves every entity of a staging world into this one. Staged entities get fresh ids
+    // and each staged pool is appended onto ours in bulk; entities without components
+    // are dropped. Returns the new ids so the region can be unloaded with destroyEntities.
+    std::vector<Entity> merge(Coordinator&& staging) {
+        std::vector<Entity> stagedEntities;
+        for (Entity entity = 0; entity < MAX_ENTITIES; ++entity) {
+            if (staging.entityManager->getSignature(entity).any()) {
+                stagedEntities.push_back(entity);
+            }
+        }
+
+        // Merge all or nothing. Worker threads may take ids concurrently, so every id is
+        // checked; if one is missing the ids already taken are freed and nothing is merged.
+        std::vector<Entity> remap(MAX_ENTITIES);
+        std::vector<Entity> region;
+        region.reserve(stagedEntities.size());
+        for (auto const& entity : stagedEntities) {
+            remap[entity] = entityManager->tryCreateEntity();
+            if (remap[entity] == NULL_ENTITY) {
+                for (auto const& taken : region) {
+                    entityManager->destroyEntity(taken);
+                }
+                assert(false && "Too many entities in existence.");
+                return {};
+            }
+            region.push_back(remap[entity]);
+        }
+
+        componentManager->merge(*staging.componentManager, remap);
+
+        for (auto const& entity : stagedEntities) {
+            auto signature = staging.entityManager->getSignature(entity);
+            entityManager->setSignature(remap[entity], signature);
+
+            if (recorder) {
+                recorder->createEntity(remap[entity]);
+                for (ComponentType type = 0; type < MAX_COMPONENTS; ++type) {
+                    if (signature.test(type)) {
+                        recorder->addComponent(remap[entity], type);
+                    }
+                }
+            }
+
+            groupManager->entitySignatureChanged(remap[entity], signature);
+            systemManager->entitySignatureChanged(remap[entity], signature);
+        }
+
+        return region;
+    }
+
     // Component methods
     template <typename T>
     void registerComponent() {
         componentManager->registerComponent<T>();
+        if (recorder) {
+            recorder->registerComponent(componentManager->getComponentType<T>(), typeid(T).name());
+        }
     }
 
     template <typename T>
     void addComponent(Entity entity, T component) {
-        componentManager->addComponent<T>(entity, component);
+        emplaceComponent<T>(entity, std::move(component));
+    }
+
+    // Constructs the component in place from args, returns a reference valid until the next structural change
+    template <typename T, typename... Args>
+    T& emplaceComponent(Entity entity, Args&&... args) {
+        componentManager->emplaceComponent<T>(entity, std::forward<Args>(args)...);
 
         auto signature = entityManager->getSignature(entity);
         signature.set(componentManager->getComponentType<T>(), true);
         entityManager->setSignature(entity, signature);
 
+        groupManager->entitySignatureChanged(entity, signature);
         systemManager->entitySignatureChanged(entity, signature);
+
+        if (recorder) {
+            recorder->addComponent(entity, componentManager->getComponentType<T>());
+        }
+
+        // Groups may have moved the component, look it up again
+        return componentManager->getComponent<T>(entity);
     }
 
     template <typename T>
     void removeComponent(Entity entity) {
-        componentManager->removeComponent<T>(entity);
-
         auto signature = entityManager->getSignature(entity);
         signature.set(componentManager->getComponentType<T>(), false);
         entityManager->setSignature(entity, signature);
 
+        // Groups must release the entity before its component is swapped out of the pool
+        groupManager->entitySignatureChanged(entity, signature);
+        componentManager->removeComponent<T>(entity);
+
         systemManager->entitySignatureChanged(entity, signature);
+
+        if (recorder) {
+            recorder->removeComponent(entity, componentManager->getComponentType<T>());
+        }
     }
 
     template <typename T>
@@ -271,26 +1213,271 @@ class Coordinator {
         return componentManager->getComponent<T>(entity);
     }
 
+    // Returns nullptr if the entity has no such component, used for Optional query terms
+    template <typename T>
+    T* tryGetComponent(Entity entity) {
+        return componentManager->tryGetComponent<T>(entity);
+    }
+
     template <typename T>
     ComponentType getComponentType() {
         return componentManager->getComponentType<T>();
     }
 
+    // Caches T's pool, use it in hot loops instead of getComponent
+    template <typename T>
+    ComponentHandle<T> getComponentHandle() {
+        return ComponentHandle<T>(componentManager->getComponentArray<T>());
+    }
+
     // System methods
     template <typename T>
     std::shared_ptr<T> registerSystem() {
         return systemManager->registerSystem<T>();
     }
 
+    template <typename T>
+    std::shared_ptr<T> getSystem() {
+        return systemManager->getSystem<T>();
+    }
+
     template <typename T>
     void setSystemSignature(Signature signature) {
-        systemManager->setSignature<T>(signature);
+        setSystemQuery<T>(Query(signature));
+    }
+
+    // Recording only, lets the replay reproduce which systems ran and over how many entities
+    void recordSystemRun(const char* name, size_t count) {
+        if (recorder) {
+            recorder->systemRun(name, count);
+        }
+    }
+
+    template <typename T>
+    void recordSystemRun(size_t count) {
+        recordSystemRun(typeid(T).name(), count);
+    }
+
+    template <typename T>
+    void setSystemQuery(Query query) {
+        systemManager->setQuery<T>(query);
+        systemManager->refreshEntities<T>(*entityManager);
+        if (recorder) {
+            recorder->systemQuery(typeid(T).name(), query);
+        }
+    }
+
+    // Query methods
+    template <typename... Terms>
+    Query compileQuery() {
+        Query query;
+        int expand[] = {(addQueryTerm(query, Terms{}), 0)...};
+        (void)expand;
+        return query;
+    }
+
+    // Group methods
+    template <typename... Ts>
+    std::shared_ptr<Group<Ts...>> registerGroup() {
+        Signature signature;
+        int expand[] = {(signature.set(componentManager->getComponentType<Ts>(), true), 0)...};
+        (void)expand;
+
+        // The group dictates the order of its pools, a sort pass would break the prefix
+        for (ComponentType type = 0; type < MAX_COMPONENTS; ++type) {
+            if (signature.test(type)) {
+                assert(!sortManager->hasPass(type) && "Cannot group a pool that is being sorted.");
+                sortManager->removePass(type);
+            }
+        }
+
+        auto group = groupManager->registerGroup<Ts...>(signature, componentManager->getComponentArray<Ts>()...);
+
+        // Pull in entities that already own every component
+        auto first = componentManager->getComponentArray<typename std::tuple_element<0, std::tuple<Ts...>>::type>();
+        std::vector<Entity> candidates;
+        for (size_t index = 0; index < first->getSize(); ++index) {
+            candidates.push_back(first->getEntity(index));
+        }
+        for (auto const& entity : candidates) {
+            group->entitySignatureChanged(entity, entityManager->getSignature(entity));
+        }
+
+        return group;
+    }
+
+    template <typename... Ts>
+    std::shared_ptr<Group<Ts...>> getGroup() {
+        return groupManager->getGroup<Ts...>();
+    }
+
+    // Event methods
+    template <typename E>
+    void registerEvent() {
+        eventManager->registerEvent<E>();
+    }
+
+    // Lock-free, may be called from worker threads
+    template <typename E>
+    bool sendEvent(const E& event) {
+        return eventManager->getEventChannel<E>()->send(event);
+    }
+
+    template <typename E>
+    EventView<E> readEvents() {
+        return eventManager->getEventChannel<E>()->read();
+    }
+
+    // Cache the channel to skip the type lookup in hot loops
+    template <typename E>
+    EventChannel<E>* getEventChannel() {
+        return eventManager->getEventChannel<E>();
+    }
+
+    // Frame boundary: last frame's events are dropped and this frame's become readable
+    void swapEvents() {
+        eventManager->swap();
+    }
+
+    // Sort methods
+
+    // Keeps T's pool ordered by key, the work is spread over defragment() calls.
+    // Pools owned by a group keep the group's order and cannot be sorted, and
+    // registerGroup drops the passes of the pools it takes over.
+    template <typename T>
+    void sortComponents(SortKey key, std::function<std::uint32_t()> dependency = nullptr) {
+        ComponentType type = componentManager->getComponentType<T>();
+        assert(!groupManager->isOwned(type) && "Cannot sort a pool owned by a group.");
+        if (groupManager->isOwned(type)) {
+            return;
+        }
+        sortManager->setPass(type, std::make_unique<SortPass<T>>(componentManager->getComponentArray<T>(), std::move(key), std::move(dependency)));
+    }
+
+    // Entity order, matches the iteration order of System::entities
+    template <typename T>
+    void sortComponents() {
+        sortComponents<T>([](Entity entity) { return std::uint64_t(entity); });
+    }
+
+    // Same order as the sibling pool U, entities missing from U go last
+    template <typename T, typename U>
+    void sortComponentsLike() {
+        ComponentArray<U>* sibling = componentManager->getComponentArray<U>();
+        sortComponents<T>(
+            [sibling](Entity entity) {
+                return sibling->hasData(entity) ? std::uint64_t(sibling->getIndex(entity)) : UINT64_MAX;
+            },
+            [sibling]() { return sibling->getLayoutVersion(); });
+    }
+
+    // Runs the registered sort passes for at most budget
+    void defragment(std::chrono::microseconds budget) {
+        sortManager->run(std::chrono::steady_clock::now() + budget);
     }
 
    private:
+    template <typename... Ts>
+    void addQueryTerm(Query& query, With<Ts...>) {
+        int expand[] = {(query.mask.set(getComponentType<Ts>()), query.value.set(getComponentType<Ts>()), 0)...};
+        (void)expand;
+    }
+
+    template <typename... Ts>
+    void addQueryTerm(Query& query, Without<Ts...>) {
+        int expand[] = {(query.mask.set(getComponentType<Ts>()), 0)...};
+        (void)expand;
+    }
+
+    template <typename... Ts>
+    void addQueryTerm(Query& query, AnyOf<Ts...>) {
+        assert(query.anyOf.none() && "Query has more than one AnyOf term.");
+        int expand[] = {(query.anyOf.set(getComponentType<Ts>()), 0)...};
+        (void)expand;
+    }
+
+    template <typename... Ts>
+    void addQueryTerm(Query&, Optional<Ts...>) {
+        // Does not filter, only checks that the components are registered
+        int expand[] = {(getComponentType<Ts>(), 0)...};
+        (void)expand;
+    }
+
+    Coordinator(const Coordinator& other) {
+        componentManager = std::make_unique<ComponentManager>(*other.componentManager);
+        entityManager = std::make_unique<EntityManager>(*other.entityManager);
+        systemManager = std::make_unique<SystemManager>(*other.systemManager);
+        groupManager = std::make_unique<GroupManager>(*other.groupManager, *componentManager);
+        eventManager = std::make_unique<EventManager>(*other.eventManager);
+        // Sort passes point into the original's pools and are not carried over
+        sortManager = std::make_unique<SortManager>();
+    }
+
     std::unique_ptr<ComponentManager> componentManager;
     std::unique_ptr<EntityManager> entityManager;
     std::unique_ptr<SystemManager> systemManager;
+    std::unique_ptr<GroupManager> groupManager;
+    std::unique_ptr<EventManager> eventManager;
+    std::unique_ptr<SortManager> sortManager;
+    CommandLog* recorder{};
 };
 
-extern Coordinator gCoordinator;
+// Structural writes recorded away from the live world, e.g. by jobs or worker threads,
+// and applied in order at the next sync point. Not thread-safe, use one buffer per writer.
+// A buffer bound to its target world remembers each target's generation when the command
+// is queued, and commit skips commands whose target has been destroyed since.
+class CommandBuffer {
+   public:
+    CommandBuffer() = default;
+    explicit CommandBuffer(const Coordinator& world) : world(&world) {}
+
+    void push(std::function<void(Coordinator&)> command) {
+        commands.push_back({NULL_ENTITY, 0, std::move(command)});
+    }
+
+    // Dropped at commit if entity was destroyed after this call, bound buffers only
+    void push(Entity entity, std::function<void(Coordinator&)> command) {
+        commands.push_back({entity, world ? world->getGeneration(entity) : 0, std::move(command)});
+    }
+
+    template <typename T>
+    void addComponent(Entity entity, T component) {
+        // Held through a shared_ptr so move-only components fit in std::function
+        auto holder = std::make_shared<T>(std::move(component));
+        push(entity, [entity, holder](Coordinator& world) { world.addComponent<T>(entity, std::move(*holder)); });
+    }
+
+    template <typename T>
+    void removeComponent(Entity entity) {
+        push(entity, [entity](Coordinator& world) { world.removeComponent<T>(entity); });
+    }
+
+    void destroyEntity(Entity entity) {
+        push(entity, [entity](Coordinator& world) { world.destroyEntity(entity); });
+    }
+
+    void commit(Coordinator& target) {
+        assert((!world || world == &target) && "Committing a bound CommandBuffer to another world.");
+        for (auto& command : commands) {
+            if (world && command.entity != NULL_ENTITY && target.getGeneration(command.entity) != command.generation) {
+                continue;
+            }
+            command.apply(target);
+        }
+        commands.clear();
+    }
+
+    bool empty() const {
+        return commands.empty();
+    }
+
+   private:
+    struct Command {
+        Entity entity;
+        std::uint32_t generation;
+        std::function<void(Coordinator&)> apply;
+    };
+
+    const Coordinator* world{};
+    std::vector<Command> commands{};
+};
@@ -1,7 +1,33 @@
 #include "game.h"
 
+#include <fstream>
 #include <raylib-cpp.hpp>
 
+#ifdef ECS_RECORD
+// build with -DECS_RECORD to capture the session for tools/replay.cpp
+const char* recordingPath = "ecs_session.log";
+std::ofstream recordingFile(recordingPath);
+CommandLog recording(recordingFile);
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+
+// The log lives in MEMFS, hand it to the browser as a download (F9 or on quit)
+EM_JS(void, downloadRecording, (const char* path), {
+    var name = UTF8ToString(path);
+    var blob = new Blob([FS.readFile(name)], { type: 'text/plain' });
+    var link = document.createElement('a');
+    link.href = URL.createObjectURL(blob);
+    link.download = name;
+    link.click();
+    URL.revokeObjectURL(link.href);
+});
+#else
+// Native builds write the log straight to disk
+void downloadRecording(const char*) {}
+#endif
+#endif
+
 Game gGame;
 
 // struct RigidBody {
@@ -12,34 +38,33 @@ struct MyTransform {
     raylib::Vector3 position;
 };
 
-// class PhysicsSystem : public System {
+// class PhysicsSystem : public ScheduledSystem {
 //    public:
-//     void update(float dt);
+//     void updateEntity(Coordinator& world, Entity entity, float dt) override;
 // };
 
-// void PhysicsSystem::update(float dt) {
-//     for (auto const& entity : entities) {
-//         auto& rigidBody = gCoordinator.getComponent<RigidBody>(entity);
-//         auto& transform = gCoordinator.getComponent<MyTransform>(entity);
-//         transform.position += rigidBody.velocity * dt;
-//     }
+// void PhysicsSystem::updateEntity(Coordinator& world, Entity entity, float dt) {
+//     auto& rigidBody = world.getComponent<RigidBody>(entity);
+//     auto& transform = world.getComponent<MyTransform>(entity);
+//     transform.position += rigidBody.velocity * dt;
 // }
 
 class RenderSystem : public System {
    public:
     raylib::Camera2D camera{};
 
-    void render();
+    void render(Coordinator& world);
 };
 
-void RenderSystem::render() {
+void RenderSystem::render(Coordinator& world) {
     BeginDrawing();
     ClearBackground(RAYWHITE);
 
     BeginMode2D(camera);
 
+    auto transforms = world.getComponentHandle<MyTransform>();
     for (auto const& entity : entities) {
-        auto& transform = gCoordinator.getComponent<MyTransform>(entity);
+        auto& transform = transforms.get(entity);
         DrawRectangle(transform.position.x, transform.position.y, 10, 10, RED);
         printf("Rendered %d\n", entity);
     }
@@ -50,8 +75,19 @@ void RenderSystem::render() {
     EndDrawing();
 }
 
-// std::shared_ptr<PhysicsSystem> gPhysicsSystem;
-std::shared_ptr<RenderSystem> gRenderSystem;
+// std::shared_ptr<PhysicsSystem> physicsSystem;
+
+// Runs on the loader thread, fills a staging world with one entity per "x y" line
+void loadLevel(Coordinator& staging, const char* path) {
+    staging.registerComponent<MyTransform>();
+
+    std::ifstream file(path);
+    float x, y;
+    while (file >> x >> y) {
+        Entity entity = staging.createEntity();
+        staging.addComponent<MyTransform>(entity, { { x, y, 0 } });
+    }
+}
 
 Game::Game() {
     printf("Initializing game.\n");
@@ -60,29 +96,33 @@ Game::Game() {
     const int screenHeight = 600;
     InitWindow(screenWidth, screenHeight, "oh uh");
 
-	gCoordinator.init();
-    gCoordinator.registerComponent<MyTransform>();
+#ifdef ECS_RECORD
+    world.setRecorder(&recording);
+#endif
+    world.registerComponent<MyTransform>();
 
-    // uint32_t physicsSystemSignature = 1 << gCoordinator.getComponentType<RigidBody>();
-    uint32_t renderSystemSignature = 1 << gCoordinator.getComponentType<MyTransform>();
-    // gPhysicsSystem = gCoordinator.registerSystem<PhysicsSystem>();
-    gRenderSystem = gCoordinator.registerSystem<RenderSystem>();
-    // gCoordinator.setSystemSignature<PhysicsSystem>(physicsSystemSignature);
-    gCoordinator.setSystemSignature<RenderSystem>(renderSystemSignature);
+    // physicsSystem = world.registerSystem<PhysicsSystem>();
+    renderSystem = world.registerSystem<RenderSystem>();
+    // world.setSystemQuery<PhysicsSystem>(world.compileQuery<With<MyTransform, RigidBody>>());
+    world.setSystemQuery<RenderSystem>(world.compileQuery<With<MyTransform>>());
+    world.sortComponents<MyTransform>();
+    // scheduler.add(physicsSystem, Schedule{});
 
-    raylib::Camera2D& cam = gRenderSystem->camera;
+    raylib::Camera2D& cam = renderSystem->camera;
     cam.target = (Vector2){0, 0};
     cam.offset = (Vector2){0, 0};
     cam.rotation = 0.0f;
     cam.zoom = 1.0f;
 
-    Entity entity = gCoordinator.createEntity();
-    gCoordinator.addComponent<Transform>(entity, { { 0, 0, 0 } });
-    // gCoordinator.addComponent<RigidBody>(entity, { { 0, 0, 0 } });
+    Entity entity = world.createEntity();
+    world.addComponent<MyTransform>(entity, { { 0, 0, 0 } });
+    // world.addComponent<RigidBody>(entity, { { 0, 0, 0 } });
 
     // for (int i = 0; i < 20; i++) {
     //     // spawn entity
     // }
+
+    loader.request([](Coordinator& staging) { loadLevel(staging, "assets/level.txt"); });
 }
 
 Game::~Game() {
@@ -90,11 +130,28 @@ Game::~Game() {
 }
 
 void Game::input() {
+#ifdef ECS_RECORD
+    if (IsKeyPressed(KEY_F9)) {
+        downloadRecording(recordingPath);
+    }
+#endif
 }
 
 void Game::update() {
-    // float dt = 1.0 / 30.0;
-    // gPhysicsSystem->update(dt);
+    world.swapEvents();
+
+    float dt = GetFrameTime();
+    scheduler.run(world, dt, std::chrono::milliseconds(8));
+
+    for (auto const& region : loader.poll(world)) {
+        level.insert(level.end(), region.begin(), region.end());
+    }
+
+    // long running jobs get a slice of the frame and commit their results when done
+    jobs.run(world, std::chrono::milliseconds(4));
+
+    // restore pool locality after churn, a little every frame
+    world.defragment(std::chrono::microseconds(500));
 
     if (WindowShouldClose()) {
         isRunning = false;
@@ -102,5 +159,14 @@ void Game::update() {
 }
 
 void Game::render() {
-    gRenderSystem->render();
+    renderSystem->render(world);
+    world.recordSystemRun<RenderSystem>(renderSystem->entities.size());
+
+#ifdef ECS_RECORD
+    // after render, so the frame's system runs are logged before its boundary
+    recording.frame(GetFrameTime());
+    if (!isRunning) {
+        downloadRecording(recordingPath);
+    }
+#endif
 }
\ No newline at end of file
@@ -1,4 +1,11 @@
+#include <memory>
+
 #include "ecs.h"
+#include "jobs.h"
+#include "loader.h"
+#include "scheduler.h"
+
+class RenderSystem;
 
 class Game {
    public:
@@ -10,6 +17,14 @@ class Game {
     void render();
 
     bool isRunning{true};
+
+   private:
+    Coordinator world;
+    JobScheduler jobs;
+    Scheduler scheduler;
+    LevelLoader loader;
+    std::vector<Entity> level;
+    std::shared_ptr<RenderSystem> renderSystem;
 };
 
 extern Game gGame;
\ No newline at end of file
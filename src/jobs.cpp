@@ -0,0 +1,45 @@
+#include "jobs.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+void JobScheduler::spawn(Coordinator& world, std::function<Job(JobContext&)> body, JobSnapshot snapshot) {
+    if (snapshot == JobSnapshot::Fork && !world.canFork()) {
+        fprintf(stderr, "Cannot snapshot a world holding components or systems that cannot be copied, spawn the job with JobSnapshot::None.\n");
+        std::abort();
+    }
+    std::unique_ptr<JobContext> context(snapshot == JobSnapshot::Fork ? new JobContext(world, world.fork()) : new JobContext(world));
+
+    // A coroutine lambda refers to its captures through the callable, so the coroutine
+    // is started from the heap copy rather than from the parameter
+    auto stableBody = std::make_unique<std::function<Job(JobContext&)>>(std::move(body));
+    Job job = (*stableBody)(*context);
+    jobs.push_back({std::move(context), std::move(stableBody), std::move(job)});
+}
+
+void JobScheduler::run(Coordinator& world, std::chrono::microseconds budget) {
+    auto deadline = JobClock::now() + budget;
+
+    // Cycle through the jobs until the budget is spent, the cursor carries over so
+    // the jobs skipped when it runs out go first next frame
+    while (!jobs.empty()) {
+        if (cursor >= jobs.size()) {
+            cursor = 0;
+        }
+
+        Entry& entry = jobs[cursor];
+        entry.context->deadline = deadline;
+        entry.job.resume();
+
+        if (entry.job.done()) {
+            entry.context->commandBuffer.commit(world);
+            jobs.erase(jobs.begin() + cursor);
+        } else {
+            ++cursor;
+        }
+
+        if (JobClock::now() >= deadline) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "ecs.h"
+
+// Coroutine-based jobs that spread long computations over several frames.
+// A job reads its own snapshot of the world, suspends at co_await points and
+// hands its writes to a CommandBuffer that is committed once the job finishes.
+
+using JobClock = std::chrono::steady_clock;
+
+class Job {
+   public:
+    struct promise_type {
+        Job get_return_object() {
+            return Job(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit Job(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    Job(Job&& other) noexcept : handle(other.handle) {
+        other.handle = nullptr;
+    }
+
+    Job& operator=(Job&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+
+    Job(const Job&) = delete;
+    Job& operator=(const Job&) = delete;
+
+    ~Job() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool done() const {
+        return !handle || handle.done();
+    }
+
+    void resume() {
+        assert(!done() && "Resuming a finished job.");
+        handle.resume();
+    }
+
+   private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+class JobContext {
+   public:
+    // Suspends unconditionally, the job continues in a later slice
+    std::suspend_always yield() {
+        return {};
+    }
+
+    // Suspends only once the current slice has used up its time budget
+    auto checkpoint() {
+        struct Awaiter {
+            bool ready;
+            bool await_ready() const noexcept { return ready; }
+            void await_suspend(std::coroutine_handle<>) const noexcept {}
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{JobClock::now() < deadline};
+    }
+
+    // Private copy of the world taken when the job was spawned
+    Coordinator& snapshot() {
+        assert(world && "Job was spawned without a snapshot.");
+        return *world;
+    }
+
+    // Writes applied to the live world once the job has finished
+    CommandBuffer& commands() {
+        return commandBuffer;
+    }
+
+   private:
+    friend class JobScheduler;
+
+    explicit JobContext(const Coordinator& live) : commandBuffer(live) {}
+    JobContext(const Coordinator& live, Coordinator world) : world(std::move(world)), commandBuffer(live) {}
+
+    // Empty for JobSnapshot::None, so such jobs do not pay for a world they never read
+    std::optional<Coordinator> world{};
+    // Bound to the live world, writes to entities destroyed while the job ran are dropped
+    CommandBuffer commandBuffer;
+    JobClock::time_point deadline{};
+};
+
+// How a job sees the world it was spawned from
+enum class JobSnapshot {
+    // The job reads a fork() of the world, which requires world.canFork(). Worlds with
+    // components that are not a CopyableComponent (e.g. std::vector paths) need None.
+    Fork,
+    // No snapshot, e.g. for worlds holding move-only components. The job may only read
+    // what its body captured and write through commands().
+    None,
+};
+
+class JobScheduler {
+   public:
+    // The body is moved to the heap before the coroutine starts and never moves again,
+    // so a coroutine lambda may use its captures across suspension points. There is no
+    // default snapshot mode, forking is not possible for every world.
+    void spawn(Coordinator& world, std::function<Job(JobContext&)> body, JobSnapshot snapshot);
+
+    // Resumes pending jobs round-robin until the budget is spent, never blocks on a job.
+    // Finished jobs commit their writes to the world before this returns.
+    void run(Coordinator& world, std::chrono::microseconds budget);
+
+    size_t pending() const {
+        return jobs.size();
+    }
+
+   private:
+    struct Entry {
+        std::unique_ptr<JobContext> context;
+        std::unique_ptr<std::function<Job(JobContext&)>> body;
+        Job job;
+    };
+
+    std::vector<Entry> jobs{};
+    size_t cursor{};
+};
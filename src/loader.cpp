@@ -0,0 +1,34 @@
+#include "loader.h"
+
+#include <chrono>
+
+// Single-threaded web builds have no thread to spare, the build then runs inside poll()
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+const std::launch LOAD_POLICY = std::launch::deferred;
+#else
+const std::launch LOAD_POLICY = std::launch::async;
+#endif
+
+void LevelLoader::request(Builder build) {
+    loads.push_back(std::async(LOAD_POLICY, [build]() {
+        Coordinator staging;
+        build(staging);
+        return staging;
+    }));
+}
+
+std::vector<std::vector<Entity>> LevelLoader::poll(Coordinator& world) {
+    std::vector<std::vector<Entity>> regions;
+
+    for (auto it = loads.begin(); it != loads.end();) {
+        // A deferred load is built right here by get()
+        if (it->wait_for(std::chrono::seconds(0)) != std::future_status::timeout) {
+            regions.push_back(world.merge(it->get()));
+            it = loads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return regions;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <vector>
+
+#include "ecs.h"
+
+// Streams content in without stalling the frame: each request builds a fresh staging
+// world on a background thread, and poll() merges finished ones into the live world.
+// Web builds without threads (the default, see THREADS in the Makefile) build the
+// staging world synchronously in the next poll() instead.
+class LevelLoader {
+   public:
+    // Registers components on and fills the staging world, off the main thread if possible
+    using Builder = std::function<void(Coordinator& staging)>;
+
+    void request(Builder build);
+
+    // Merges every staging world that has finished, never waits on one still loading.
+    // Returns one region per merged load, pass it to destroyEntities to unload it.
+    std::vector<std::vector<Entity>> poll(Coordinator& world);
+
+    size_t pending() const {
+        return loads.size();
+    }
+
+   private:
+    std::vector<std::future<Coordinator>> loads{};
+};
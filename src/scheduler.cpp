@@ -0,0 +1,123 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <typeinfo>
+
+using SchedulerClock = std::chrono::steady_clock;
+
+void Scheduler::add(std::shared_ptr<ScheduledSystem> system, Schedule schedule) {
+    assert(schedule.interval > 0 && "Schedule interval must be at least one frame.");
+
+    Entry entry{};
+    entry.system = std::move(system);
+    entry.schedule = std::move(schedule);
+    entry.lastUpdate = std::make_unique<std::array<double, MAX_ENTITIES>>();
+    entry.lastUpdate->fill(time);
+    entry.visits = std::make_unique<std::array<std::uint8_t, MAX_ENTITIES>>();
+    entries.push_back(std::move(entry));
+}
+
+void Scheduler::run(Coordinator& world, float dt, std::chrono::microseconds frameBudget) {
+    // Entities that joined since the last run, possibly under a recycled id, start counting from now
+    for (auto& entry : entries) {
+        auto& entered = entry.system->entered;
+        size_t remaining = entered.count();
+        for (Entity entity = 0; remaining > 0; ++entity) {
+            if (entered.test(entity)) {
+                (*entry.lastUpdate)[entity] = time;
+                (*entry.visits)[entity] = 0;
+                --remaining;
+            }
+        }
+        entered.reset();
+    }
+
+    time += dt;
+    auto frameDeadline = SchedulerClock::now() + frameBudget;
+
+    // Plan this frame's quotas and predict their cost from past measurements
+    quotas.resize(entries.size());
+    double predicted = 0.0;
+    for (size_t index = 0; index < entries.size(); ++index) {
+        auto& entry = entries[index];
+        size_t count = entry.system->entities.size();
+        // Capped at one full pass, so a set that shrinks does not bank credit
+        entry.quotaCredit = std::min(entry.quotaCredit + double(count) / entry.schedule.interval, double(count));
+        quotas[index] = size_t(entry.quotaCredit + 1e-9);
+        entry.quotaCredit = std::max(0.0, entry.quotaCredit - quotas[index]);
+        predicted += quotas[index] * entry.stats.costPerEntity;
+    }
+
+    // Over budget - every system gives up the same share, but keeps making progress
+    double budget = double(frameBudget.count());
+    if (predicted > budget && predicted > 0.0) {
+        double scale = budget / predicted;
+        for (auto& quota : quotas) {
+            if (quota > 0) {
+                quota = std::max<size_t>(1, size_t(quota * scale));
+            }
+        }
+    }
+
+    for (size_t index = 0; index < entries.size(); ++index) {
+        auto& entry = entries[index];
+
+        auto start = SchedulerClock::now();
+        auto deadline = frameDeadline;
+        if (entry.schedule.budget.count() > 0) {
+            deadline = std::min(deadline, start + entry.schedule.budget);
+        }
+
+        size_t updated = runEntry(entry, world, quotas[index], deadline);
+        if (updated > 0) {
+            world.recordSystemRun(typeid(*entry.system).name(), updated);
+        }
+
+        std::chrono::duration<double, std::micro> elapsed = SchedulerClock::now() - start;
+        entry.stats.lastFrameTime = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+        entry.stats.lastUpdated = updated;
+        if (updated > 0) {
+            double sample = elapsed.count() / updated;
+            entry.stats.costPerEntity = entry.stats.costPerEntity == 0.0 ? sample : 0.9 * entry.stats.costPerEntity + 0.1 * sample;
+        }
+    }
+}
+
+size_t Scheduler::runEntry(Entry& entry, Coordinator& world, size_t quota, SchedulerClock::time_point deadline) {
+    auto const& entities = entry.system->entities;
+    auto const& schedule = entry.schedule;
+    if (entities.empty()) {
+        return 0;
+    }
+
+    quota = std::min(quota, entities.size());
+    size_t updated = 0;
+
+    // Continue where the last frame stopped, wrapping around the entity set
+    auto it = entities.lower_bound(entry.cursor);
+    for (size_t visited = 0; visited < quota; ++visited) {
+        if (it == entities.end()) {
+            it = entities.begin();
+        }
+        Entity entity = *it;
+        ++it;
+
+        std::uint8_t tier = schedule.tier ? schedule.tier(entity) : 0;
+        if (tier > 0 && (*entry.visits)[entity]++ % (1u << tier) != 0) {
+            continue;
+        }
+
+        double& last = (*entry.lastUpdate)[entity];
+        float entityDt = float(time - last);
+        last = time;
+        entry.system->updateEntity(world, entity, std::min(entityDt, schedule.maxDt));
+        ++updated;
+
+        if (SchedulerClock::now() >= deadline) {
+            break;
+        }
+    }
+
+    entry.cursor = it == entities.end() ? 0 : *it;
+    return updated;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "ecs.h"
+
+// A system whose per-entity work the Scheduler may spread across frames
+class ScheduledSystem : public System {
+   public:
+    // dt is the time since this entity was last updated, or since it joined the system
+    virtual void updateEntity(Coordinator& world, Entity entity, float dt) = 0;
+
+    void entityAdded(Entity entity) override {
+        entered.set(entity);
+    }
+
+   private:
+    friend class Scheduler;
+
+    // Joined since the Scheduler last ran, their per-entity state starts over
+    std::bitset<MAX_ENTITIES> entered{};
+};
+
+struct Schedule {
+    // Each entity is visited once every interval frames
+    std::uint32_t interval{1};
+    // Hard limit per frame for this system, zero means no limit
+    std::chrono::microseconds budget{0};
+    // Optional LOD tier per entity, tier n entities are only updated on every 2^n-th visit
+    std::function<std::uint8_t(Entity)> tier{};
+    // Upper bound for the dt handed to an entity, time above it is dropped. No limit by default.
+    float maxDt{std::numeric_limits<float>::infinity()};
+};
+
+// Runs scheduled systems round-robin over their entities. Every frame each system gets
+// a quota of entities to visit (fractions carry over, so a set smaller than the interval
+// still waits interval frames per entity), and quotas shrink evenly when the measured
+// per-entity costs predict that the frame budget would be exceeded. Entities that are skipped keep
+// their accumulated dt and are picked up first on the next frame.
+class Scheduler {
+   public:
+    struct Stats {
+        // Moving average of the cost of one entity update in microseconds
+        double costPerEntity{};
+        std::chrono::microseconds lastFrameTime{};
+        size_t lastUpdated{};
+    };
+
+    void add(std::shared_ptr<ScheduledSystem> system, Schedule schedule);
+
+    void run(Coordinator& world, float dt, std::chrono::microseconds frameBudget);
+
+    const Stats& getStats(size_t index) const {
+        return entries[index].stats;
+    }
+
+   private:
+    struct Entry {
+        std::shared_ptr<ScheduledSystem> system;
+        Schedule schedule;
+        Stats stats{};
+        Entity cursor{};
+        double quotaCredit{};
+        std::unique_ptr<std::array<double, MAX_ENTITIES>> lastUpdate;
+        std::unique_ptr<std::array<std::uint8_t, MAX_ENTITIES>> visits;
+    };
+
+    std::vector<Entry> entries{};
+    std::vector<size_t> quotas{};
+    double time{};
+
+    size_t runEntry(Entry& entry, Coordinator& world, size_t quota, std::chrono::steady_clock::time_point deadline);
+};
@@ -0,0 +1,430 @@
+// Replays a CommandLog recorded from a real session against the ECS core, headless and at
+// full speed, and reports the frame time distribution. With a baseline it fails when the
+// run is slower than the baseline by more than the tolerance.
+//
+//   replay <log> [--runs N] [--baseline file] [--write-baseline file] [--tolerance 0.1]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ecs.h"
+
+const size_t MAX_REPLAY_SYSTEMS = 32;
+
+// Stand-in for a recorded component type, the log only knows its type index
+template <size_t I>
+struct Payload {
+    std::array<float, 8> data{};
+};
+
+// Stand-in for a recorded system, only its query is known
+template <size_t I>
+class ReplaySystem : public System {};
+
+struct ComponentOps {
+    ComponentType (*registerComponent)(Coordinator&);
+    void (*addComponent)(Coordinator&, Entity);
+    void (*removeComponent)(Coordinator&, Entity);
+    float (*touch)(Coordinator&, Entity);
+};
+
+struct SystemOps {
+    std::shared_ptr<System> (*registerSystem)(Coordinator&);
+    void (*setQuery)(Coordinator&, Query);
+};
+
+template <size_t I>
+ComponentOps makeComponentOps() {
+    return {
+        [](Coordinator& world) {
+            world.registerComponent<Payload<I>>();
+            return world.getComponentType<Payload<I>>();
+        },
+        [](Coordinator& world, Entity entity) { world.emplaceComponent<Payload<I>>(entity); },
+        [](Coordinator& world, Entity entity) { world.removeComponent<Payload<I>>(entity); },
+        [](Coordinator& world, Entity entity) {
+            auto& payload = world.getComponent<Payload<I>>(entity);
+            payload.data[0] += 1.0f;
+            return payload.data[0];
+        },
+    };
+}
+
+template <size_t I>
+SystemOps makeSystemOps() {
+    return {
+        [](Coordinator& world) -> std::shared_ptr<System> { return world.registerSystem<ReplaySystem<I>>(); },
+        [](Coordinator& world, Query query) { world.setSystemQuery<ReplaySystem<I>>(query); },
+    };
+}
+
+template <size_t... Is>
+std::array<ComponentOps, sizeof...(Is)> makeComponentTable(std::index_sequence<Is...>) {
+    return {{makeComponentOps<Is>()...}};
+}
+
+template <size_t... Is>
+std::array<SystemOps, sizeof...(Is)> makeSystemTable(std::index_sequence<Is...>) {
+    return {{makeSystemOps<Is>()...}};
+}
+
+const auto componentTable = makeComponentTable(std::make_index_sequence<MAX_COMPONENTS>{});
+const auto systemTable = makeSystemTable(std::make_index_sequence<MAX_REPLAY_SYSTEMS>{});
+
+struct Op {
+    char kind;
+    Entity entity{};
+    unsigned type{};
+    size_t count{};
+    float dt{};
+    Query query{};
+    std::string name{};
+};
+
+// The whole log is parsed up front so file I/O stays out of the measurement. The replay
+// runs without asserts, so anything the ECS would reject is rejected here: ids and types
+// out of range, types used before registration, and ops on entities in the wrong state.
+bool parseLog(const char* path, std::vector<Op>& ops) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    Signature registered;
+    std::vector<bool> living(MAX_ENTITIES);
+    std::vector<Signature> signatures(MAX_ENTITIES);
+    std::set<std::string> systemNames;
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        std::istringstream in(line);
+        Op op{};
+        if (!(in >> op.kind)) {
+            continue;
+        }
+
+        const char* error = nullptr;
+        switch (op.kind) {
+            case 'r':
+                in >> op.type >> op.name;
+                if (in && op.type < MAX_COMPONENTS) {
+                    error = registered.test(op.type) ? "component registered twice" : nullptr;
+                    registered.set(op.type);
+                }
+                break;
+            case 'q':
+                in >> op.name >> op.query.mask >> op.query.value >> op.query.anyOf;
+                if (in && ((op.query.mask | op.query.anyOf) & ~registered).any()) {
+                    error = "query on an unregistered component";
+                } else if (in && systemNames.insert(op.name).second && systemNames.size() > MAX_REPLAY_SYSTEMS) {
+                    error = "too many systems";
+                }
+                break;
+            case 'c':
+            case 'd':
+                in >> op.entity;
+                if (in && op.entity < MAX_ENTITIES) {
+                    if (living[op.entity] == (op.kind == 'c')) {
+                        error = op.kind == 'c' ? "entity created twice" : "destroying an entity that is not alive";
+                    }
+                    living[op.entity] = op.kind == 'c';
+                    signatures[op.entity].reset();
+                }
+                break;
+            case 'a':
+            case 'x':
+                in >> op.entity >> op.type;
+                if (in && op.entity < MAX_ENTITIES && op.type < MAX_COMPONENTS) {
+                    if (!registered.test(op.type)) {
+                        error = "unregistered component";
+                    } else if (!living[op.entity]) {
+                        error = "entity is not alive";
+                    } else if (signatures[op.entity].test(op.type) == (op.kind == 'a')) {
+                        error = op.kind == 'a' ? "component added twice" : "removing a missing component";
+                    }
+                    signatures[op.entity].set(op.type, op.kind == 'a');
+                }
+                break;
+            case 'u':
+                in >> op.name >> op.count;
+                break;
+            case 'f':
+                in >> op.dt;
+                break;
+            default:
+                fprintf(stderr, "Unknown op '%c' in log.\n", op.kind);
+                return false;
+        }
+
+        if (!in) {
+            error = "truncated or malformed op";
+        } else if (op.entity >= MAX_ENTITIES) {
+            error = "entity out of range";
+        } else if (op.type >= MAX_COMPONENTS) {
+            error = "component type out of range";
+        }
+        if (error) {
+            fprintf(stderr, "Line %zu: %s.\n", lineNumber, error);
+            return false;
+        }
+        ops.push_back(op);
+    }
+    return true;
+}
+
+// Maps a recorded signature onto the types of the placeholder components
+Signature translate(Signature recorded, const std::array<ComponentType, MAX_COMPONENTS>& replayTypes) {
+    Signature signature;
+    for (ComponentType type = 0; type < MAX_COMPONENTS; ++type) {
+        if (recorded.test(type)) {
+            signature.set(replayTypes[type]);
+        }
+    }
+    return signature;
+}
+
+struct ReplayedSystem {
+    std::shared_ptr<System> system;
+    Signature required;
+    Entity cursor;
+};
+
+// Reads and writes each component the system requires on count of its entities,
+// continuing round-robin where its last run stopped
+float runSystem(Coordinator& world, ReplayedSystem& replayed, size_t count, const std::array<ComponentType, MAX_COMPONENTS>& slotTypes, ComponentType slots) {
+    auto const& entities = replayed.system->entities;
+    if (entities.empty()) {
+        return 0.0f;
+    }
+
+    float checksum = 0.0f;
+    auto it = entities.lower_bound(replayed.cursor);
+    for (size_t visited = 0; visited < std::min(count, entities.size()); ++visited) {
+        if (it == entities.end()) {
+            it = entities.begin();
+        }
+        for (ComponentType slot = 0; slot < slots; ++slot) {
+            if (replayed.required.test(slotTypes[slot])) {
+                checksum += componentTable[slot].touch(world, *it);
+            }
+        }
+        ++it;
+    }
+    replayed.cursor = it == entities.end() ? 0 : *it;
+    return checksum;
+}
+
+// Replays the log once into a fresh world and appends one sample per frame in microseconds.
+// Logs without system runs ('u') predate them, there every system covers all of its
+// entities once per frame instead.
+float replay(const std::vector<Op>& ops, bool hasSystemRuns, std::vector<double>& samples) {
+    using Clock = std::chrono::steady_clock;
+
+    Coordinator world;
+    std::vector<Entity> entities(MAX_ENTITIES);
+    // Recorded type -> placeholder slot, and recorded type -> placeholder's type in this world
+    std::array<ComponentType, MAX_COMPONENTS> typeSlots{};
+    std::array<ComponentType, MAX_COMPONENTS> replayTypes{};
+    std::array<ComponentType, MAX_COMPONENTS> slotTypes{};
+    ComponentType nextSlot = 0;
+    std::map<std::string, size_t> systemSlots;
+    std::vector<ReplayedSystem> systems;
+    float checksum = 0.0f;
+
+    auto frameStart = Clock::now();
+    for (auto const& op : ops) {
+        switch (op.kind) {
+            case 'r':
+                assert(nextSlot < MAX_COMPONENTS && "Too many component types in log.");
+                typeSlots[op.type] = nextSlot;
+                slotTypes[nextSlot] = componentTable[nextSlot].registerComponent(world);
+                replayTypes[op.type] = slotTypes[nextSlot];
+                ++nextSlot;
+                break;
+            case 'q': {
+                Query query;
+                query.mask = translate(op.query.mask, replayTypes);
+                query.value = translate(op.query.value, replayTypes);
+                query.anyOf = translate(op.query.anyOf, replayTypes);
+
+                auto it = systemSlots.find(op.name);
+                if (it == systemSlots.end()) {
+                    assert(systems.size() < MAX_REPLAY_SYSTEMS && "Too many systems in log.");
+                    it = systemSlots.insert({op.name, systems.size()}).first;
+                    systems.push_back({systemTable[it->second].registerSystem(world), Signature{}, 0});
+                }
+                systemTable[it->second].setQuery(world, query);
+                systems[it->second].required = query.value;
+                break;
+            }
+            case 'c':
+                entities[op.entity] = world.createEntity();
+                break;
+            case 'd':
+                world.destroyEntity(entities[op.entity]);
+                break;
+            case 'a':
+                componentTable[typeSlots[op.type]].addComponent(world, entities[op.entity]);
+                break;
+            case 'x':
+                componentTable[typeSlots[op.type]].removeComponent(world, entities[op.entity]);
+                break;
+            case 'u': {
+                // Systems that never got a query have no entities to touch
+                auto it = systemSlots.find(op.name);
+                if (it != systemSlots.end()) {
+                    checksum += runSystem(world, systems[it->second], op.count, slotTypes, nextSlot);
+                }
+                break;
+            }
+            case 'f': {
+                if (!hasSystemRuns) {
+                    for (auto& system : systems) {
+                        checksum += runSystem(world, system, system.system->entities.size(), slotTypes, nextSlot);
+                    }
+                }
+
+                auto frameEnd = Clock::now();
+                samples.push_back(std::chrono::duration<double, std::micro>(frameEnd - frameStart).count());
+                frameStart = frameEnd;
+                break;
+            }
+        }
+    }
+
+    return checksum;
+}
+
+std::map<std::string, double> summarize(std::vector<double> samples) {
+    std::map<std::string, double> stats;
+    std::sort(samples.begin(), samples.end());
+
+    double total = 0.0;
+    for (auto const& sample : samples) {
+        total += sample;
+    }
+
+    auto percentile = [&samples](double p) {
+        return samples[std::min(samples.size() - 1, size_t(p * samples.size()))];
+    };
+
+    stats["frames"] = double(samples.size());
+    stats["mean_us"] = total / samples.size();
+    stats["p50_us"] = percentile(0.50);
+    stats["p90_us"] = percentile(0.90);
+    stats["p99_us"] = percentile(0.99);
+    stats["max_us"] = samples.back();
+    return stats;
+}
+
+bool readStats(const char* path, std::map<std::string, double>& stats) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        auto split = line.find('=');
+        if (split != std::string::npos) {
+            stats[line.substr(0, split)] = std::stod(line.substr(split + 1));
+        }
+    }
+    return true;
+}
+
+void writeStats(FILE* out, const std::map<std::string, double>& stats) {
+    for (auto const& pair : stats) {
+        fprintf(out, "%s=%.3f\n", pair.first.c_str(), pair.second);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <log> [--runs N] [--baseline file] [--write-baseline file] [--tolerance 0.1]\n", argv[0]);
+        return 2;
+    }
+
+    const char* logPath = argv[1];
+    const char* baselinePath = nullptr;
+    const char* writeBaselinePath = nullptr;
+    int runs = 5;
+    double tolerance = 0.1;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--runs") == 0) {
+            runs = std::max(1, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            baselinePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--write-baseline") == 0) {
+            writeBaselinePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = atof(argv[i + 1]);
+        } else {
+            fprintf(stderr, "Unknown option %s.\n", argv[i]);
+            return 2;
+        }
+    }
+
+    std::vector<Op> ops;
+    if (!parseLog(logPath, ops)) {
+        fprintf(stderr, "Could not read log %s.\n", logPath);
+        return 2;
+    }
+
+    bool hasSystemRuns = std::any_of(ops.begin(), ops.end(), [](Op const& op) { return op.kind == 'u'; });
+
+    std::vector<double> samples;
+    float checksum = 0.0f;
+    for (int run = 0; run < runs; ++run) {
+        checksum += replay(ops, hasSystemRuns, samples);
+    }
+    if (samples.empty()) {
+        fprintf(stderr, "Log %s has no frames.\n", logPath);
+        return 2;
+    }
+
+    auto stats = summarize(samples);
+    writeStats(stdout, stats);
+    printf("checksum=%.1f\n", checksum);
+
+    if (writeBaselinePath) {
+        FILE* file = fopen(writeBaselinePath, "w");
+        if (!file) {
+            fprintf(stderr, "Could not write baseline %s.\n", writeBaselinePath);
+            return 2;
+        }
+        writeStats(file, stats);
+        fclose(file);
+    }
+
+    if (baselinePath) {
+        std::map<std::string, double> baseline;
+        if (!readStats(baselinePath, baseline)) {
+            fprintf(stderr, "Could not read baseline %s.\n", baselinePath);
+            return 2;
+        }
+
+        bool regressed = false;
+        for (auto const& key : {"mean_us", "p50_us", "p99_us"}) {
+            if (baseline.count(key) && stats[key] > baseline[key] * (1.0 + tolerance)) {
+                printf("REGRESSION %s: %.3f vs baseline %.3f\n", key, stats[key], baseline[key]);
+                regressed = true;
+            }
+        }
+        return regressed ? 1 : 0;
+    }
+
+    return 0;
+}